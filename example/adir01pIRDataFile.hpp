@@ -0,0 +1,66 @@
+#pragma once
+#include "adir01pcpp.hpp"
+
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+
+//サンプルプログラムが使う赤外線データのファイルの形式
+//1行目に周波数, その後に赤外線データを1byteずつ, 全て16進数で空白か改行で区切って並べる。
+
+//ファイルから赤外線データを読み込み, 周波数をfrequencyに入れる。
+inline adir01pcpp::IRData readIRDataFile(std::istream& istrm, uint16_t& frequency) {
+    istrm >> std::hex;
+    istrm >> frequency;
+    if(istrm.fail())
+        throw std::runtime_error("Invalid input");
+
+    if(!adir01pcpp::checkFrequency(frequency))
+        throw std::runtime_error("Unsupported frequency");
+
+    adir01pcpp::IRData  data;
+    int c;
+    while(istrm >> c) {
+        if(c > 0xff)
+            throw std::runtime_error("Invalid input");
+        data.push_back(static_cast<adir01pcpp::IRData::value_type>(c));
+    }
+
+    if(!istrm.eof())
+        throw std::runtime_error("Invalid input");
+
+    return data;
+}
+
+//赤外線データをファイルに書き込む。writeを何回か呼んで続けて書き込むこともできる。
+class irDataFileWriter {
+public:
+    irDataFileWriter(std::ostream& ost, uint16_t frequency):
+        ost(ost),
+        count(0) {
+        ost << std::hex;
+        ost << frequency << '\n';
+        check();
+    }
+
+    void write(const adir01pcpp::IRData& data) {
+        for(const auto v : data) {
+            count++;
+            ost.width(2*sizeof(data[0]));
+            ost << int(v) << ((count&0xf) == 0 ? '\n' : ' ');
+            check();
+        }
+
+        ost.flush();
+        check();
+    }
+
+private:
+    void check() {
+        if(ost.fail())
+            throw std::runtime_error("Error while writing IR data\n");
+    }
+
+    std::ostream&   ost;
+    size_t          count;
+};
@@ -0,0 +1,78 @@
+#include "adir01pcpp.hpp"
+#include "adir01pIRDataFile.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+//同じ信号を間を空けずに続けて送り, sendIRを呼んでから戻るまでの時間
+//(ボタンを押してから発光が始まるまでの遅延)と全体の所要時間を測る。
+//2回目以降のsendIRは前の送信が終わるまで待つことになる。
+void measure(adir01pcpp& device, const adir01pcpp::IRData& data, uint16_t frequency, int count, bool lowLatency) {
+    typedef chrono::duration<double, milli> msec;
+
+    device.setLowLatencySend(lowLatency);
+    if(!device.waitSendComplete(5s))
+        throw runtime_error("adir01p is busy");
+
+    vector<double> latencies;
+    const auto first = chrono::steady_clock::now();
+    for(int i=0; i<count; ++i) {
+        const auto begin = chrono::steady_clock::now();
+        device.sendIR(data, frequency);
+        latencies.push_back(msec(chrono::steady_clock::now() - begin).count());
+    }
+    if(!device.waitSendComplete(5s))
+        throw runtime_error("Transmission did not complete");
+    const auto total = msec(chrono::steady_clock::now() - first).count();
+
+    sort(latencies.begin(), latencies.end());
+    double sum = 0;
+    for(const auto t : latencies)
+        sum += t;
+
+    cout << (lowLatency ? "Low latency mode\n" : "Compatible mode\n")
+         << "    Latency until transmission starts: mean " << sum / count
+         << " ms, median " << latencies[latencies.size() / 2]
+         << " ms, max " << latencies.back() << " ms\n"
+         << "    Until all transmissions complete: " << total
+         << " ms (" << total / count << " ms per signal)\n";
+}
+
+int main(int argc, char** argv) {
+    try {
+        if(argc < 2) {
+            cerr << "Usage: " << argv[0] << " FILE [COUNT]\n"
+                 << "Transmit IR data from FILE COUNT times back to back in each send mode and report latency\n";
+            return 1;
+        }
+
+        ifstream ifs(argv[1]);
+        if(!ifs.good()) {
+            cerr << "Failed to open file: " << argv[1] << endl;
+            return 1;
+        }
+        uint16_t frequency;
+        const auto data = readIRDataFile(ifs, frequency);
+        const int count = argc > 2 ? stoi(argv[2]) : 20;
+        if(count <= 0)
+            throw runtime_error("COUNT must be positive");
+
+        adir01pcpp device;
+        cout << "Estimated burst duration: "
+             << chrono::duration<double, milli>(adir01pcpp::estimateDuration(data, frequency)).count() << " ms\n";
+        measure(device, data, frequency, count, false);
+        measure(device, data, frequency, count, true);
+    }catch(const exception& e){
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,5 +1,7 @@
 #include "adir01pcpp.hpp"
+#include "adir01pIRDataFile.hpp"
 
+#include <chrono>
 #include <fstream>
 #include <iostream>
 #include <stdexcept>
@@ -19,22 +21,8 @@ int read(ostream& ost) {
     adir01pcpp::printIRData(cout, data);
 #endif
 
-    ost << hex;
-    ost << adir01pcpp::frequencyDefault << '\n';
-
-    size_t c = 0;
-    for(const auto v : data) {
-        c++;
-        ost.width(2*sizeof(data[0]));
-        ost << int(v) << ((c&0xf) == 0 ? '\n' : ' ');
-        if(ost.fail()) {
-            throw runtime_error("Error while writing IR data\n");
-        }
-    }
-
-    ost.flush();
-    if(ost.fail())
-        throw runtime_error("Error while writing IR data\n");
+    irDataFileWriter writer(ost, adir01pcpp::frequencyDefault);
+    writer.write(data);
 
     clog << "Received IR data has been written\n";
 
@@ -58,26 +46,39 @@ int read(int argc, char** argv) {
     return read(cout);
 }
 
-int send(istream& istrm, adir01pcpp& device) {
-    istrm >> hex;
-    uint16_t frequency;
-    istrm >> frequency;
-    if(istrm.fail())
-        throw runtime_error("Invalid input");
-
-    if(!adir01pcpp::checkFrequency(frequency))
-        throw runtime_error("Unsupported frequency");
-
-    adir01pcpp::IRData  data; 
-    int c;
-    while(istrm >> c) {
-        if(c > 0xff)
-            throw runtime_error("Invalid input");
-        data.push_back(static_cast<adir01pcpp::IRData::value_type>(c));
+int readLong(int argc, char** argv) {
+    if(argc < 3 || argv[2] == string("help")) {
+        cerr << "Usage: " << argv[0] << " " << argv[1] << " FILE [SECONDS]\n"
+             << "Read IR data for SECONDS seconds (default 60) and write it to FILE in the same format as r\n"
+             << "Data longer than the buffer of the ADIR01P is split and each split is marked with the bytes "
+             << hex << (adir01pcpp::gapMarkerOn >> 8) << ' ' << (adir01pcpp::gapMarkerOn & 0xff) << ' '
+             << (adir01pcpp::gapMarkerOff >> 8) << ' ' << (adir01pcpp::gapMarkerOff & 0xff) << '\n';
+        return argc < 3 ? 1 : 0;
+    }
+
+    unsigned long seconds = 60;
+    if(argc > 3) {
+        try {
+            seconds = stoul(argv[3]);
+        }catch(const invalid_argument& e) {
+            throw runtime_error("Invalid argument was given as SECONDS");
+        }
     }
 
-    if(!istrm.eof())
-        throw runtime_error("Invalid input");
+    adir01pcpp  device;
+    const auto end = chrono::steady_clock::now() + chrono::seconds(seconds);
+    device.readLongIRData(
+        adir01pcpp::makeFileSink(argv[2], adir01pcpp::frequencyDefault),
+        [end] {return chrono::steady_clock::now() < end;});
+
+    clog << "Received IR data has been written\n";
+
+    return 0;
+}
+
+int send(istream& istrm, adir01pcpp& device) {
+    uint16_t frequency;
+    const auto data = readIRDataFile(istrm, frequency);
 
     device.sendIR(data, frequency);
 
@@ -154,6 +155,8 @@ int main(int argc, char** argv) {
         if(argc > 1) {
             if(string("r") == argv[1]) {
                 ret = read(argc, argv);
+            } else if(string("l") == argv[1]) {
+                ret = readLong(argc, argv);
             } else if(string("s") == argv[1]) {
                 ret = send(argc, argv);
             } else if(string("v") == argv[1]) {
@@ -169,6 +172,7 @@ int main(int argc, char** argv) {
             cerr << "Usage: " << argv[0] << " {COMMAND [help] | help}\n"
                  << "COMMAND\n"
                  << "    r    Read IR data and write to file or stdout\n"
+                 << "    l    Read long IR data for specified seconds and write to file\n"
                  << "    s    Send IR data from file or stdin\n"
                  << "    v    Show firmware version of the ADIR01P\n";
         }
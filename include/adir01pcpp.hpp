@@ -1,6 +1,10 @@
 #pragma once
+#include <chrono>
+#include <functional>
+#include <iosfwd>
 #include <memory>
 #include <string>
+#include <system_error>
 #include <vector>
 
 class adir01pcpp {
@@ -11,14 +15,98 @@ public:
     const static uint16_t frequencyMax      = 50000;
     const static uint16_t frequencyDefault  = 38000;
 
+    //readLongIRDataで読み取りを区切ったところに入る点灯時間と消灯時間の組。
+    const static uint16_t gapMarkerOn       = 0;
+    const static uint16_t gapMarkerOff      = 0xffff;
+    //readLongIRDataでバッファに溜まったデータがこの量(4byte単位)になったら読み取りを区切る。
+    //ADIR01Pのバッファの正確な大きさはわからないので余裕を持たせている。
+    const static uint16_t rollSizeDefault   = 500;
+
+    //readLongIRDataで区切った読み取りデータを受け取る関数
+    typedef std::function<void(const IRData& segment)> segmentSink;
+
+    //例外(std::system_error)やstd::error_code引数で返されるエラーの種類。
+    //libusbのエラーはlibusbのエラー番号がそのまま別のカテゴリで返される。
+    enum class errc {
+        deviceNotFound = 1,
+        sendFailed,
+        receiveFailed,
+        commandFailed,
+        readFailed,
+        notReadyToTransmit,
+        fileError,
+        invalidTrace,
+        traceMismatch,
+        invalidSignal,
+    };
+    static const std::error_category& errorCategory() noexcept;
+
+    //同じ信号を何度も送るときのために, 信号を検査してADIR01Pに送るUSBパケットに変換しておいたもの。
+    //adir01pcpp::prepareで作る。
+    class PreparedSignal {
+    public:
+        uint16_t getFrequency() const noexcept {
+            return frequency;
+        }
+
+        std::chrono::microseconds getDuration() const noexcept {
+            return duration;
+        }
+
+    private:
+        friend class adir01pcpp;
+
+        std::vector<uint8_t>        packets;
+        uint16_t                    frequency = frequencyDefault;
+        std::chrono::microseconds   duration{0};
+    };
+
+    //記録ファイルを再生するときに, 送ったパケットを記録と照合する方法。
+    enum class replayMode {
+        //命令ごとに記録された応答を順に返す。送信状態の問い合わせなどの回数が記録と違っても再生できる。
+        //記録より多く問い合わせた命令には最後の応答を繰り返す。
+        //送信データ(setSendDataReq, sendDataReq)のパケットだけは記録と完全に一致しなければならない。
+        byCommand,
+        //全てのパケットが記録と同じ順番で完全に一致しなければならない。
+        strict,
+    };
+
+    //ADIR01PCPP_LEANでビルドした場合はADIR01Pを最初に使うときかopenを呼んだときに開く。
     adir01pcpp();
+    //startUSBRecordで記録したファイルをADIR01Pの代わりに再生する。実機は不要。
+    //keepTimingをtrueにすると記録時のパケットの間隔も再現する。
+    explicit adir01pcpp(const std::string& traceFile, bool keepTiming = false, replayMode mode = replayMode::byCommand);
+    //例外を投げる代わりにecにエラーを返す版。
+    //記録ファイルを開けなかった場合, 他のメンバ関数は同じエラーを返す。
+    explicit adir01pcpp(std::error_code& ec);
+    adir01pcpp(const std::string& traceFile, std::error_code& ec, bool keepTiming = false, replayMode mode = replayMode::byCommand);
     ~adir01pcpp();
 
+    void open();
+
+    //ADIR01Pと送受信したUSBパケットを時刻付きでファイルに記録する。
+    void startUSBRecord(const std::string& traceFile);
+    void stopUSBRecord();
+
     std::string getFirmwareVersion();
     //これを呼んでから受光部に信号を送ると読み取ったデータが返る。
     IRData readIRData(uint16_t frequency = frequencyDefault);
     //readIRDataで得た赤外線データを送信する。
+    //送信の開始を指示したところで戻るので, 送信が終わるのを待つときはwaitSendCompleteを呼ぶ。
     void sendIR(const IRData& data, uint16_t frequency = frequencyDefault);
+    //prepareで変換済みの信号を送信する。送信の度に信号を検査したりパケットを作ったりしない。
+    void sendIR(const PreparedSignal& signal);
+    //trueにするとsendIRは前の送信が終わるのを100msごとではなく短い間隔で確認して待つ。
+    //estimateDurationがtrueならwaitSendCompleteは送信が終わる予定の時刻まで確認せずに待つ。
+    //見積もりはデータの値を搬送波の周期の数とみなしたもので, 実機では確かめていない。
+    //見積もりが長すぎると遅延が増えるので, 実機で合っていることを確かめてから使うこと。
+    void setLowLatencySend(bool enable, bool estimateDuration = false) noexcept;
+    //直前のsendIRの送信が終わるまで待つ。timeoutまでに終わらなければfalseを返す。
+    bool waitSendComplete(std::chrono::milliseconds timeout = std::chrono::milliseconds(1000));
+    //dataを検査してsendIRで送るUSBパケットに変換しておく。dataやfrequencyが不正ならinvalidSignalを投げる。
+    static PreparedSignal prepare(const IRData& data, uint16_t frequency = frequencyDefault);
+    //dataの送信にかかる時間の見積もり。
+    static std::chrono::microseconds estimateDuration(const IRData& data, uint16_t frequency = frequencyDefault) noexcept;
 
     //受光部で読み取ったデータをリアルタイムに取得したいときには以下のメンバ関数を使う。
     void readStart(uint16_t frequency = frequencyDefault);
@@ -29,10 +117,37 @@ public:
     //readStartしてからreadStopするまでに読み取った赤外線データを返す。
     IRData getReadData();
 
+    //ADIR01Pのバッファに収まらない長さの信号を読み取る。isContinueがfalseを返すまで読み取り続ける。
+    //バッファがいっぱいになる前に読み取りを止めてデータを取り出してから読み取りを再開し, 取り出したデータをsinkに渡す。
+    //2回目以降に渡すデータの先頭には区切り(gapMarkerOn, gapMarkerOff)が入るので, 全てをつなげると一続きのデータになる。
+    void readLongIRData(const segmentSink& sink, const std::function<bool()>& isContinue, uint16_t frequency = frequencyDefault, uint16_t rollSize = rollSizeDefault);
+    //受け取ったデータをファイルに書き込むsinkを作る。ファイルはexample/adir01psendが読み書きする形式で,
+    //1行目にfrequency, その後にデータを1byteずつ, 全て16進数で空白か改行で区切って並べる。
+    //frequencyにはreadLongIRDataに渡したものと同じ値を渡す。
+    static segmentSink makeFileSink(const std::string& filename, uint16_t frequency = frequencyDefault);
+
+    //例外を投げる代わりにecにエラーを返す版。
+    void open(std::error_code& ec);
+    void startUSBRecord(const std::string& traceFile, std::error_code& ec);
+    std::string getFirmwareVersion(std::error_code& ec);
+    IRData readIRData(std::error_code& ec, uint16_t frequency = frequencyDefault);
+    void sendIR(const IRData& data, std::error_code& ec, uint16_t frequency = frequencyDefault);
+    void sendIR(const PreparedSignal& signal, std::error_code& ec);
+    static PreparedSignal prepare(const IRData& data, std::error_code& ec, uint16_t frequency = frequencyDefault);
+    bool waitSendComplete(std::error_code& ec, std::chrono::milliseconds timeout = std::chrono::milliseconds(1000));
+    void readStart(std::error_code& ec, uint16_t frequency = frequencyDefault);
+    IRData getReadingData(std::error_code& ec);
+    void readStop(std::error_code& ec);
+    IRData getReadData(std::error_code& ec);
+    void readLongIRData(const segmentSink& sink, const std::function<bool()>& isContinue, std::error_code& ec, uint16_t frequency = frequencyDefault, uint16_t rollSize = rollSizeDefault);
+    static segmentSink makeFileSink(const std::string& filename, std::error_code& ec, uint16_t frequency = frequencyDefault);
+
     static bool checkFrequency(uint16_t frequency) noexcept;
 
+    //ADIR01PCPP_LEANでビルドした場合は何も出力されない。
     static void enableDebugPrint() noexcept;
     static void enableUSBIOPrint() noexcept;
+    //ADIR01PCPP_LEANでビルドした場合はadir01pcppprintライブラリをリンクする。
     static void printIRData(std::ostream& ost, const IRData& data);
 
 private:
@@ -40,3 +155,10 @@ private:
 
     std::unique_ptr<adir01pcppImpl> impl;
 };
+
+std::error_code make_error_code(adir01pcpp::errc e) noexcept;
+
+namespace std {
+    template<>
+    struct is_error_code_enum<adir01pcpp::errc> : true_type {};
+}
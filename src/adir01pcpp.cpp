@@ -1,14 +1,19 @@
 #include "adir01pcpp.hpp"
 
 #include <cassert>
+#include <cstdio>
 #include <cstring>
 #include <stdexcept>
 #include <vector>
 #include <libusb-1.0/libusb.h>
 
+#include <chrono>
+#include <map>
 #include <memory>
-#include <iostream>
 #include <thread>
+#ifndef ADIR01PCPP_LEAN
+#include <iostream>
+#endif
 
 using namespace std;
 
@@ -43,6 +48,16 @@ namespace {
     const static uint8_t    EP_4_IN         = 0x84;
     const static uint8_t    EP_4_OUT        = 0x04;
     const static unsigned int usbTimeout    = 5000;
+    //setSendDataReq命令1回で送れる赤外線データの量(4byte単位)
+    const static uint8_t    sendDataChunkSize = 0xe;
+
+    //低遅延送信モードで送信状態を問い合わせる間隔の最小値と最大値
+    const static auto sendPollIntervalMin   = chrono::milliseconds(1);
+    const static auto sendPollIntervalMax   = chrono::milliseconds(16);
+    //送信可能になるまで待つ時間。通常のモードの100ms x 5回に合わせる。
+    const static auto sendReadyTimeout      = chrono::milliseconds(500);
+    //長時間の読み取りでバッファに溜まったデータの量を確認する間隔
+    const static auto capturePollInterval   = chrono::milliseconds(10);
 
     //ADIR01Pを操作したりデータを取得するときにUSB経由で送る命令のコード
     //リモコンの赤外線信号を読み取りたいだけなら以下の順番で命令を送る。
@@ -81,7 +96,19 @@ namespace {
         return sizeof(t) + sizeofParams(args...);
     }
 
-    void debugPrint(uint8_t* buf, size_t size) {
+    bool enableDebugPrint = false;
+    bool isDebugPrint() {
+        return enableDebugPrint;
+    }
+
+    bool enableUSBIOPrint = false;
+    bool isUSBIOPrint() {
+        return enableUSBIOPrint;
+    }
+
+    //ADIR01PCPP_LEANではiostreamを使わないようにデバッグ出力を全て取り除く。
+#ifndef ADIR01PCPP_LEAN
+    void debugPrint(const uint8_t* buf, size_t size) {
         clog << std::hex;
         clog << "Size: " << size << endl;
         for(size_t i=0; i<size; ++i) {
@@ -93,30 +120,124 @@ namespace {
             clog << endl;
     }
 
-    bool enableDebugPrint = false;
-    bool isDebugPrint() {
-        return enableDebugPrint;
+    template<typename... Args>
+    void debugLog(const Args&... args) {
+        clog << std::hex;
+        using expander = int[];
+        (void)expander{0, (clog << args, 0)...};
+    }
+#else
+    void debugPrint(const uint8_t*, size_t) {
     }
 
-    bool enableUSBIOPrint = false;
-    bool isUSBIOPrint() {
-        return enableUSBIOPrint;
+    template<typename... Args>
+    void debugLog(const Args&...) {
+    }
+#endif
+
+    class errorCategoryImpl : public std::error_category {
+    public:
+        const char* name() const noexcept override {
+            return "adir01pcpp";
+        }
+
+        std::string message(int e) const override {
+            switch(static_cast<adir01pcpp::errc>(e)) {
+            case adir01pcpp::errc::deviceNotFound:
+                return "ADIR01P was not found";
+            case adir01pcpp::errc::sendFailed:
+                return "Failed to send a packet to adir01p";
+            case adir01pcpp::errc::receiveFailed:
+                return "Failed to receive a packet from adir01p";
+            case adir01pcpp::errc::commandFailed:
+                return "Failed to execute command to adir01p";
+            case adir01pcpp::errc::readFailed:
+                return "Failed to read IR data";
+            case adir01pcpp::errc::notReadyToTransmit:
+                return "adir01p is not ready to transmit IR";
+            case adir01pcpp::errc::fileError:
+                return "File I/O error";
+            case adir01pcpp::errc::invalidTrace:
+                return "Invalid USB trace";
+            case adir01pcpp::errc::traceMismatch:
+                return "Packet does not match USB trace";
+            case adir01pcpp::errc::invalidSignal:
+                return "Invalid IR signal";
+            }
+            return "Unknown error";
+        }
+    };
+
+    class libusbCategoryImpl : public std::error_category {
+    public:
+        const char* name() const noexcept override {
+            return "libusb";
+        }
+
+        std::string message(int e) const override {
+            return libusb_strerror(static_cast<libusb_error>(e));
+        }
+    };
+
+    const std::error_category& libusbCategory() noexcept {
+        static const libusbCategoryImpl category;
+        return category;
+    }
+
+    [[noreturn]] void fail(adir01pcpp::errc e) {
+        throw std::system_error(make_error_code(e));
+    }
+
+    [[noreturn]] void fail(adir01pcpp::errc e, const std::string& what) {
+        throw std::system_error(make_error_code(e), what);
+    }
+
+    //例外を投げる関数をstd::error_codeでエラーを返す関数にする。
+    template<typename F>
+    auto withErrorCode(std::error_code& ec, F f) -> decltype(f()) {
+        ec.clear();
+        try {
+            return f();
+        }catch(const std::system_error& e) {
+            ec = e.code();
+        }
+        return decltype(f())();
     }
 
     auto makeLibusbContext() {
         libusb_context* libusbContext;
         if(libusb_init(&libusbContext) != 0)
-            throw std::runtime_error("Failed to call libusb_init");
+            throw std::system_error(LIBUSB_ERROR_OTHER, libusbCategory(), "Failed to call libusb_init");
         auto deleter = [](libusb_context* p) {
             libusb_exit(p);};
         return unique_ptr<libusb_context, decltype(deleter)>(libusbContext, deleter);
     }
+
+    auto openFile(const std::string& filename, const char* mode) {
+        FILE* fp = fopen(filename.c_str(), mode);
+        if(!fp)
+            fail(adir01pcpp::errc::fileError, filename);
+        auto deleter = [](FILE* p) {
+            fclose(p);};
+        return unique_ptr<FILE, decltype(deleter)>(fp, deleter);
+    }
+
+    //USB通信の記録ファイルの形式
+    //先頭にtraceMagicがあり, その後に送受信したパケットが1つずつ以下の形式で順に並ぶ。
+    //  1byte   向き(traceOut: ホストからADIR01Pへ, traceIn: ADIR01Pからホストへ)
+    //  8byte   記録開始からの経過時間(マイクロ秒, ビッグエンディアン)
+    //  64byte  パケットの内容
+    const static char       traceMagic[8]   = {'A', 'D', 'I', 'R', 'T', 'R', 'C', '1'};
+    const static uint8_t    traceOut        = 0;
+    const static uint8_t    traceIn         = 1;
+    const static size_t     traceHeaderSize = 1 + 8;
+    const static size_t     traceRecordSize = traceHeaderSize + PacketSize;
 }
 
-class libusbException : public std::runtime_error {
+class libusbException : public std::system_error {
 public:
     libusbException(libusb_error e):
-        std::runtime_error(libusb_strerror(e)) {
+        std::system_error(e, libusbCategory()) {
     }
 
     libusbException(int e):
@@ -159,48 +280,282 @@ namespace {
 
         return unique_ptr<struct libusb_device_handle, decltype(deleter)>(devHandle, deleter);
     }
-}
 
-class adir01pcpp::adir01pcppImpl {
-public:
-    adir01pcppImpl():
-        libusbContext(makeLibusbContext()),
-        devHandle(openDevHandle(libusbContext.get())) {
-        if(!devHandle)
-            throw std::runtime_error("ADIR01P was not found");
-        auto devHandle = this->devHandle.get();
-        {
-            const auto ret = libusb_kernel_driver_active(devHandle,interfaceNum);
-            if(ret == 1){
-                const auto ret = libusb_detach_kernel_driver(devHandle, interfaceNum);
+    class traceRecorder {
+    public:
+        traceRecorder(const std::string& filename):
+            file(openFile(filename, "wb")),
+            begin(chrono::steady_clock::now()) {
+            if(fwrite(traceMagic, sizeof(traceMagic), 1, file.get()) != 1)
+                fail(adir01pcpp::errc::fileError, "Failed to write USB trace");
+        }
+
+        void record(uint8_t direction, const uint8_t* packet) {
+            const auto elapsed = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - begin);
+            const auto t = static_cast<uint64_t>(elapsed.count());
+
+            uint8_t buffer[traceRecordSize];
+            buffer[0] = direction;
+            for(size_t i=0; i<8; ++i)
+                buffer[1+i] = uint8_t(t >> (8*(7-i)));
+            memcpy(buffer + traceHeaderSize, packet, PacketSize);
+            //異常終了したときに原因を調べられるように, パケットごとにファイルに書き出す。
+            if(fwrite(buffer, sizeof(buffer), 1, file.get()) != 1 || fflush(file.get()) != 0)
+                fail(adir01pcpp::errc::fileError, "Failed to write USB trace");
+        }
+
+    private:
+        decltype(openFile(std::string(), "")) file;
+        const chrono::steady_clock::time_point begin;
+    };
+
+    //ADIR01Pとパケットをやりとりする経路。
+    //実機ならlibusbを使い, 記録ファイルの再生ならファイルから読む。
+    class transport {
+    public:
+        virtual ~transport() {
+        }
+
+        //outを送ってから受け取ったパケットをinに書き込む。outとinは同じバッファでもよい。
+        void transfer(const uint8_t* out, uint8_t* in) {
+            send(out);
+            if(recorder)
+                recorder->record(traceOut, out);
+            receive(in);
+            if(recorder)
+                recorder->record(traceIn, in);
+        }
+
+        std::unique_ptr<traceRecorder> recorder;
+
+    protected:
+        virtual void send(const uint8_t* packet) = 0;
+        virtual void receive(uint8_t* packet) = 0;
+    };
+
+    class usbTransport : public transport {
+    public:
+        usbTransport():
+            libusbContext(makeLibusbContext()),
+            devHandle(openDevHandle(libusbContext.get())) {
+            if(!devHandle)
+                fail(adir01pcpp::errc::deviceNotFound);
+            auto devHandle = this->devHandle.get();
+            {
+                const auto ret = libusb_kernel_driver_active(devHandle,interfaceNum);
+                if(ret == 1){
+                    const auto ret = libusb_detach_kernel_driver(devHandle, interfaceNum);
+                    if(ret != 0)
+                        throw libusbException(ret);
+                }else if(ret != 0)
+                    throw libusbException(ret);
+            }
+
+            {
+                const auto ret = libusb_claim_interface(devHandle, interfaceNum);
                 if(ret != 0)
                     throw libusbException(ret);
-            }else if(ret != 0)
+            }
+        }
+
+    protected:
+        void send(const uint8_t* packet) override {
+            int transferred;
+            const auto ret = libusb_interrupt_transfer(devHandle.get(), EP_4_OUT, const_cast<uint8_t*>(packet), PacketSize, &transferred, usbTimeout);
+            if(ret < 0)
                 throw libusbException(ret);
+            if(transferred != PacketSize)
+                fail(adir01pcpp::errc::sendFailed);
         }
 
-        {
-            const auto ret = libusb_claim_interface(devHandle, interfaceNum);
-            if(ret != 0)
+        void receive(uint8_t* packet) override {
+            int transferred;
+            const auto ret = libusb_interrupt_transfer(devHandle.get(), EP_4_IN, packet, PacketSize, &transferred, usbTimeout);
+            if(ret < 0)
                 throw libusbException(ret);
+            if(transferred != PacketSize)
+                fail(adir01pcpp::errc::receiveFailed);
+        }
+
+    private:
+        decltype(makeLibusbContext()) libusbContext;
+        decltype(openDevHandle(libusbContext.get())) devHandle;
+    };
+
+    //traceRecorderで記録したファイルの受信パケットを実機の代わりに返す。
+    //記録は送ったパケットと受け取ったパケットの組にして全て読み込んでおく。
+    class replayTransport : public transport {
+    public:
+        replayTransport(const std::string& filename, bool keepTiming, adir01pcpp::replayMode mode):
+            keepTiming(keepTiming),
+            mode(mode),
+            isFirst(true),
+            nextIndex(0),
+            current(0) {
+            auto file = openFile(filename, "rb");
+            char magic[sizeof(traceMagic)];
+            if(fread(magic, sizeof(magic), 1, file.get()) != 1 || memcmp(magic, traceMagic, sizeof(magic)) != 0)
+                fail(adir01pcpp::errc::invalidTrace, filename);
+
+            uint8_t buffer[traceRecordSize];
+            while(fread(buffer, traceRecordSize, 1, file.get()) == 1) {
+                exchange e;
+                if(buffer[0] != traceOut)
+                    fail(adir01pcpp::errc::invalidTrace, "USB trace is broken");
+                memcpy(e.out, buffer + traceHeaderSize, PacketSize);
+
+                if(fread(buffer, traceRecordSize, 1, file.get()) != 1 || buffer[0] != traceIn)
+                    fail(adir01pcpp::errc::invalidTrace, "USB trace is broken");
+                memcpy(e.in, buffer + traceHeaderSize, PacketSize);
+                e.time = 0;
+                for(size_t i=0; i<8; ++i)
+                    e.time = e.time << 8 | buffer[1+i];
+
+                byCommand[e.out[0]].indices.push_back(exchanges.size());
+                exchanges.push_back(e);
+            }
+        }
+
+    protected:
+        void send(const uint8_t* packet) override {
+            const auto cmd = packet[0];
+            if(mode == adir01pcpp::replayMode::strict) {
+                if(nextIndex >= exchanges.size())
+                    fail(adir01pcpp::errc::invalidTrace, "USB trace has ended");
+                current = nextIndex++;
+            }else{
+                const auto it = byCommand.find(cmd);
+                if(it == byCommand.end())
+                    fail(adir01pcpp::errc::traceMismatch, "Command " + toHex(packet, 1) + " is not in USB trace");
+                auto& queue = it->second;
+                if(queue.pos < queue.indices.size())
+                    current = queue.indices[queue.pos++];
+                else if(isSendDataCommand(cmd))
+                    fail(adir01pcpp::errc::invalidTrace, "USB trace has ended");
+                else
+                    //問い合わせの回数が記録より多い場合は最後の応答を繰り返す。
+                    current = queue.indices.back();
+            }
+
+            //送信データはいつも記録と完全に一致しなければならない。違っていればライブラリの動作が変わったということ。
+            const auto& e = exchanges[current];
+            if((mode == adir01pcpp::replayMode::strict || isSendDataCommand(cmd)) && memcmp(e.out, packet, PacketSize) != 0) {
+                fail(
+                    adir01pcpp::errc::traceMismatch,
+                    "Record " + std::to_string(current * 2)
+                    + ": expected " + toHex(e.out, PacketSize)
+                    + ", sent " + toHex(packet, PacketSize));
+            }
+        }
+
+        void receive(uint8_t* packet) override {
+            const auto& e = exchanges[current];
+            if(keepTiming) {
+                const auto elapsed = chrono::microseconds(e.time);
+                //最初の応答を返す時刻を記録の最初の応答の時刻に合わせる。
+                if(isFirst) {
+                    begin = chrono::steady_clock::now() - elapsed;
+                    isFirst = false;
+                }
+                this_thread::sleep_until(begin + elapsed);
+            }
+            memcpy(packet, e.in, PacketSize);
+        }
+
+    private:
+        struct exchange {
+            uint8_t     out[PacketSize];
+            uint8_t     in[PacketSize];
+            //応答を受け取った時刻(記録開始からのマイクロ秒)
+            uint64_t    time;
+        };
+
+        //命令ごとの記録の位置
+        struct commandQueue {
+            std::vector<size_t> indices;
+            size_t              pos = 0;
+        };
+
+        static bool isSendDataCommand(uint8_t cmd) {
+            return cmd == deviceCmds::setSendDataReq || cmd == deviceCmds::sendDataReq;
+        }
+
+        static std::string toHex(const uint8_t* packet, size_t size) {
+            std::string str;
+            for(size_t i=0; i<size; ++i) {
+                char digits[4];
+                snprintf(digits, sizeof(digits), i == 0 ? "%02x" : " %02x", packet[i]);
+                str += digits;
+            }
+            return str;
         }
+
+        const bool                          keepTiming;
+        const adir01pcpp::replayMode        mode;
+        bool                                isFirst;
+        chrono::steady_clock::time_point    begin;
+        std::vector<exchange>               exchanges;
+        std::map<uint8_t, commandQueue>     byCommand;
+        //strictで次に使う記録
+        size_t                              nextIndex;
+        //直前に送ったパケットに対応する記録
+        size_t                              current;
+    };
+}
+
+class adir01pcpp::adir01pcppImpl {
+public:
+    adir01pcppImpl() {
+    }
+
+    adir01pcppImpl(std::unique_ptr<transport> port):
+        port(std::move(port)) {
     }
 
     ~adir01pcppImpl() {
     }
 
+    void setTransport(std::unique_ptr<transport> port) {
+        this->port = std::move(port);
+    }
+
+    //記録ファイルを開けなかったことを覚えておく。
+    //実機を開きに行かないように, 以後はADIR01Pを使おうとするとこのエラーを投げる。
+    void setReplayError(std::error_code ec) {
+        port.reset();
+        replayError = ec;
+    }
+
+    //ADIR01Pがまだ開かれていなければ開く。
+    transport& device() {
+        if(replayError)
+            throw std::system_error(replayError);
+        if(!port)
+            port = std::make_unique<usbTransport>();
+        return *port;
+    }
+
+    void startUSBRecord(const std::string& filename) {
+        device().recorder = std::make_unique<traceRecorder>(filename);
+    }
+
+    void stopUSBRecord() {
+        if(port)
+            port->recorder.reset();
+    }
+
     std::string getFirmwareVersion() {
-        deviceIO io(devHandle.get(), deviceCmds::getFirmwareVersion);
+        deviceIO io(device(), deviceCmds::getFirmwareVersion);
         io.buffer[PacketSize-1] = 0;
         return std::string(reinterpret_cast<char*>(io.buffer + 1));
     }
 
     void readStartReq(uint16_t frequency) {
         if(isDebugPrint())
-            clog << "readStartReq\n";
+            debugLog("readStartReq\n");
 
         deviceIO io(
-            devHandle.get(),
+            device(),
             deviceCmds::readStartReq, frequency,
             uint8_t(0),     // 読み込み停止フラグ　停止なし
             uint16_t(0),    // 読み込み停止ON時間
@@ -210,11 +565,11 @@ public:
 
     void readStopReq() {
         if(isDebugPrint())
-            clog << "readStopReq\n";
+            debugLog("readStopReq\n");
 
-        deviceIO io(devHandle.get(), deviceCmds::readStopReq);
+        deviceIO io(device(), deviceCmds::readStopReq);
         if(io.buffer[1] != 0) {
-            throw std::runtime_error("Failed to read IR data");
+            fail(adir01pcpp::errc::readFailed);
         }
     }
 
@@ -222,9 +577,16 @@ public:
         return getData(irdata, deviceCmds::readingDataGetReq);
     }
 
+    //読み取り中のバッファに溜まっているデータの量(4byte単位)
+    uint16_t readingDataSize() {
+        deviceIO io(device(), deviceCmds::readingDataGetReq);
+        size_t p = 1;
+        return io.get<uint16_t>(p);
+    }
+
     bool readDataGetReq(IRData& irdata) {
         if(isDebugPrint())
-            clog << "readDataGetReq\n";
+            debugLog("readDataGetReq\n");
 
         return getData(irdata, deviceCmds::readDataGetReq);
     }
@@ -232,46 +594,103 @@ public:
     //falseなら未送信状態
     bool getSendStatusReq() {
         if(isDebugPrint())
-            clog << "getSendStatus\n";
+            debugLog("getSendStatus\n");
 
-        deviceIO io(devHandle.get(), deviceCmds::getSendStatusReq);
+        deviceIO io(device(), deviceCmds::getSendStatusReq);
 
         size_t p = 2;
         return io.get<uint8_t>(p) != 0;
     }
 
-    size_t setSendDataReq(const IRData& data, uint16_t pos) {
+    //encodeSendDataが作るパケットの数(setSendDataReqのパケット数 + sendDataReqのパケット)
+    static size_t sendDataPacketCount(const IRData& data) {
+        const auto totalSize = data.size() / 4;
+        return (totalSize + sendDataChunkSize - 1) / sendDataChunkSize + 1;
+    }
+
+    //setSendDataReqとsendDataReqで送るパケットを1つずつ作り, 順にemitに渡す。
+    //パケットは1つのバッファを使い回して作るので, emitから戻ったら内容は変わる。
+    template<typename F>
+    static void encodeSendData(const IRData& data, uint16_t frequency, F emit) {
         const auto totalSize = uint16_t(data.size() / 4);
-        const static uint8_t sizeMax = 0xe;
-        const uint16_t sizeLeft = totalSize - pos;
-        const uint8_t size = sizeLeft > sizeMax ? sizeMax : uint8_t(sizeLeft); 
+        packet p;
+        for(uint16_t pos = 0; pos < totalSize;) {
+            const uint16_t sizeLeft = totalSize - pos;
+            const uint8_t size = sizeLeft > sendDataChunkSize ? sendDataChunkSize : uint8_t(sizeLeft);
+            p.setCmd(
+                deviceCmds::setSendDataReq,
+                totalSize,
+                pos,
+                size,
+                data.begin() + pos*4,
+                data.begin() + (pos + size)*4
+                );
+            emit(static_cast<const uint8_t*>(p.buffer));
+            pos += size;
+        }
+
+        p.setCmd(deviceCmds::sendDataReq, frequency, totalSize);
+        emit(static_cast<const uint8_t*>(p.buffer));
+    }
 
-        assert(pos < totalSize);
+    //送信するデータのパケットを作りながら送る。
+    void sendData(const IRData& data, uint16_t frequency) {
+        encodeSendData(data, frequency, [this](const uint8_t* out) {
+            deviceIO io(device(), out);});
+    }
 
-        deviceIO io(
-            devHandle.get(),
-            deviceCmds::setSendDataReq,
-            totalSize,
-            pos,
-            size,
-            data.begin() + pos*4,
-            data.begin() + (pos + size)*4
-            );
-        return pos + size;
+    //prepareで作ったパケットをそのまま送る。
+    void sendPackets(const std::vector<uint8_t>& packets) {
+        for(size_t i=0; i<packets.size(); i+=PacketSize)
+            deviceIO io(device(), packets.data() + i);
     }
 
-    void sendDataReq(uint16_t frequency, uint16_t size) {
-        deviceIO io(
-            devHandle.get(),
-            deviceCmds::sendDataReq,
-            frequency,
-            size);
+    void setLowLatencySend(bool enable, bool estimate) {
+        lowLatencySend = enable;
+        estimateDuration = estimate;
+    }
+
+    //前の送信が終わって次の信号を送れるようになるまで待つ。
+    void waitSendReady() {
+        if(lowLatencySend) {
+            if(!waitSendComplete(chrono::steady_clock::now() + sendReadyTimeout))
+                fail(adir01pcpp::errc::notReadyToTransmit);
+        }else{
+            for(int i=0; i<5 && getSendStatusReq(); ++i) {
+                this_thread::sleep_for(100ms);
+            }
+            if(getSendStatusReq())
+                fail(adir01pcpp::errc::notReadyToTransmit);
+        }
+    }
+
+    //sendDataReqを送った後に呼び, 送信が終わる予定の時刻を覚えておく。
+    void sendStarted(chrono::microseconds duration) {
+        sendEnd = chrono::steady_clock::now() + duration;
+    }
+
+    //送信中でなくなるまで送信状態を問い合わせる。deadlineまでに終わらなければfalseを返す。
+    //問い合わせの間隔はsendPollIntervalMinから倍々にしてsendPollIntervalMaxまで延ばす。
+    //送信時間を見積もっている場合は送信が終わる予定の時刻まで問い合わせずに待つ。
+    bool waitSendComplete(chrono::steady_clock::time_point deadline) {
+        if(estimateDuration)
+            this_thread::sleep_until(std::min(sendEnd, deadline));
+
+        chrono::steady_clock::duration interval = sendPollIntervalMin;
+        while(getSendStatusReq()) {
+            const auto now = chrono::steady_clock::now();
+            if(now >= deadline)
+                return false;
+            this_thread::sleep_for(std::min(interval, deadline - now));
+            interval = std::min<chrono::steady_clock::duration>(interval * 2, sendPollIntervalMax);
+        }
+        return true;
     }
 
 private:
 
     bool getData(IRData& irdata, uint8_t cmd) {
-        deviceIO io(devHandle.get(), cmd);
+        deviceIO io(device(), cmd);
         size_t p = 1;
         const auto totalSize    = io.get<uint16_t>(p);
         if(totalSize == 0)
@@ -281,9 +700,8 @@ private:
         const auto size         = io.get<uint8_t>(p);
 
         if(totalSize >= startPos + size && size > 0) {
-            if(isDebugPrint()) {
-                clog << "Copying IR Data(total:" << std::hex << totalSize << ", startPos: " << startPos << ", size: " << int(size) << ")" << endl;
-            }
+            if(isDebugPrint())
+                debugLog("Copying IR Data(total:", totalSize, ", startPos: ", startPos, ", size: ", int(size), ")\n");
             for(size_t i=0; i<size*4; ++i)
                 irdata.push_back(io.get<uint8_t>(p));
             return totalSize > startPos + size;
@@ -291,12 +709,7 @@ private:
             return false;
     }
 
-    struct deviceIO {
-        template<typename... Args>
-        deviceIO(struct libusb_device_handle *devHandle, uint8_t cmd, Args... args) {
-            io(devHandle, cmd, args...);
-        }
-
+    struct packet {
         template<typename T>
         T get(size_t& pos) const {
             T v = 0;
@@ -309,44 +722,13 @@ private:
         }
 
         template<typename... Args>
-        void io(struct libusb_device_handle *devHandle, uint8_t cmd, Args... args) {
-            setCmd(cmd, args...);
-            int transferred;
-            {
-                if(isUSBIOPrint()) {
-                    clog << "Sending to USB\n";
-                    debugPrint(buffer, PacketSize);
-                }
-                const auto ret = libusb_interrupt_transfer(devHandle, EP_4_OUT, buffer, PacketSize, &transferred, usbTimeout);
-                if(ret < 0)
-                    throw libusbException(ret);
-                if(transferred != PacketSize)
-                    throw std::runtime_error("Failed to send a packet to adir01p");
-            }
-
-            {
-                const auto ret = libusb_interrupt_transfer(devHandle, EP_4_IN, buffer, PacketSize, &transferred, usbTimeout);
-                if(ret < 0)
-                    throw libusbException(ret);
-                if(transferred != PacketSize)
-                    throw std::runtime_error("Failed to receive a packet from adir01p");
-            }
-
-            if(buffer[0] != cmd)
-                throw std::runtime_error("Failed to execute comand to adir01p");
-            if(isUSBIOPrint()) {
-                clog << "Received from USB\n";
-                debugPrint(buffer, PacketSize);
-            }
+        void setCmd(uint8_t cmd, Args... args) {
+            write(0, cmd, args...);
         }
 
         uint8_t buffer[PacketSize];
 
     private:
-        template<typename... Args>
-        void setCmd(uint8_t cmd, Args... args) {
-            write(0, cmd, args...);
-        }
 
         void write(size_t pos) {
             assert(pos < PacketSize);
@@ -384,19 +766,94 @@ private:
         }
     };
 
-    decltype(makeLibusbContext()) libusbContext;
-    decltype(openDevHandle(libusbContext.get())) devHandle;
+    struct deviceIO : packet {
+        template<typename... Args>
+        deviceIO(transport& port, uint8_t cmd, Args... args) {
+            setCmd(cmd, args...);
+            io(port, buffer);
+        }
+
+        //作成済みのパケットoutを送る。受け取ったパケットはbufferに入る。
+        deviceIO(transport& port, const uint8_t* out) {
+            io(port, out);
+        }
+
+    private:
+        void io(transport& port, const uint8_t* out) {
+            const auto cmd = out[0];
+            if(isUSBIOPrint()) {
+                debugLog("Sending to USB\n");
+                debugPrint(out, PacketSize);
+            }
+            port.transfer(out, buffer);
+
+            if(buffer[0] != cmd)
+                fail(adir01pcpp::errc::commandFailed);
+            if(isUSBIOPrint()) {
+                debugLog("Received from USB\n");
+                debugPrint(buffer, PacketSize);
+            }
+        }
+    };
+
+    std::unique_ptr<transport> port;
+    std::error_code replayError;
+    bool lowLatencySend = false;
+    bool estimateDuration = false;
+    chrono::steady_clock::time_point sendEnd;
 };
 
 adir01pcpp::adir01pcpp():
     impl(std::make_unique<adir01pcppImpl>())
 {
+#ifndef ADIR01PCPP_LEAN
+    open();
+#endif
+}
+
+adir01pcpp::adir01pcpp(const std::string& traceFile, bool keepTiming, replayMode mode):
+    impl(std::make_unique<adir01pcppImpl>(std::make_unique<replayTransport>(traceFile, keepTiming, mode)))
+{
+}
+
+adir01pcpp::adir01pcpp(std::error_code& ec):
+    impl(std::make_unique<adir01pcppImpl>())
+{
+#ifndef ADIR01PCPP_LEAN
+    open(ec);
+#else
+    ec.clear();
+#endif
+}
+
+adir01pcpp::adir01pcpp(const std::string& traceFile, std::error_code& ec, bool keepTiming, replayMode mode):
+    impl(std::make_unique<adir01pcppImpl>())
+{
+    withErrorCode(ec, [this, &traceFile, keepTiming, mode] {
+        impl->setTransport(std::make_unique<replayTransport>(traceFile, keepTiming, mode));});
+    if(ec)
+        impl->setReplayError(ec);
 }
 
 adir01pcpp::~adir01pcpp()
 {
 }
 
+void adir01pcpp::open()
+{
+    impl->device();
+}
+
+void adir01pcpp::startUSBRecord(const std::string& traceFile)
+{
+    impl->startUSBRecord(traceFile);
+}
+
+void adir01pcpp::stopUSBRecord()
+{
+    impl->stopUSBRecord();
+}
+
 std::string adir01pcpp::getFirmwareVersion()
 {
     return impl->getFirmwareVersion();
@@ -418,18 +875,134 @@ adir01pcpp::IRData adir01pcpp::readIRData(uint16_t frequency) {
 }
 
 void adir01pcpp::sendIR(const adir01pcpp::IRData& data, uint16_t frequency) {
-    for(int i=0; i<5 && impl->getSendStatusReq(); ++i) {
-        this_thread::sleep_for(100ms);
-    }
-    if(impl->getSendStatusReq())
-        throw std::runtime_error("adir01p is not ready to transmit IR");
+    impl->waitSendReady();
+    impl->sendData(data, frequency);
+    impl->sendStarted(estimateDuration(data, frequency));
+}
+
+adir01pcpp::PreparedSignal adir01pcpp::prepare(const IRData& data, uint16_t frequency) {
+    if(!checkFrequency(frequency))
+        fail(errc::invalidSignal, "Unsupported frequency");
+    if(data.empty() || data.size() % 4 != 0 || data.size() / 4 > 0xffff)
+        fail(errc::invalidSignal, "Invalid IR data size");
+
+    PreparedSignal signal;
+    signal.frequency = frequency;
+    signal.duration = estimateDuration(data, frequency);
+    signal.packets.reserve(adir01pcppImpl::sendDataPacketCount(data) * PacketSize);
+    adir01pcppImpl::encodeSendData(data, frequency, [&signal](const uint8_t* out) {
+        signal.packets.insert(signal.packets.end(), out, out + PacketSize);});
+
+    return signal;
+}
+
+void adir01pcpp::sendIR(const PreparedSignal& signal) {
+    //prepareで作っていないPreparedSignal
+    if(signal.packets.empty())
+        fail(errc::invalidSignal);
+
+    impl->waitSendReady();
+    impl->sendPackets(signal.packets);
+    impl->sendStarted(signal.duration);
+}
+
+void adir01pcpp::setLowLatencySend(bool enable, bool estimateDuration) noexcept {
+    impl->setLowLatencySend(enable, estimateDuration);
+}
+
+bool adir01pcpp::waitSendComplete(std::chrono::milliseconds timeout) {
+    return impl->waitSendComplete(chrono::steady_clock::now() + timeout);
+}
 
-    size_t pos = 0;
-    do {
-        pos = impl->setSendDataReq(data, pos);
-    } while(pos*4 < data.size());
+std::chrono::microseconds adir01pcpp::estimateDuration(const IRData& data, uint16_t frequency) noexcept {
+    if(frequency == 0)
+        return chrono::microseconds(0);
 
-    impl->sendDataReq(frequency, data.size()/4);
+    //データの値は搬送波の周期を単位とした点灯時間と消灯時間だとみなして合計する。
+    uint64_t periods = 0;
+    for(size_t i=0; i+1<data.size(); i+=2)
+        periods += uint16_t(data[i] << 8 | data[i+1]);
+    return chrono::microseconds(periods * 1000000 / frequency);
+}
+
+void adir01pcpp::readLongIRData(const segmentSink& sink, const std::function<bool()>& isContinue, uint16_t frequency, uint16_t rollSize) {
+    const uint8_t gap[] = {
+        uint8_t(gapMarkerOn >> 8), uint8_t(gapMarkerOn),
+        uint8_t(gapMarkerOff >> 8), uint8_t(gapMarkerOff)};
+
+    //sinkなどが例外を投げて抜けたときにADIR01Pが読み取りを続けたままにならないようにする。
+    //ここで止められなくても元の例外を優先する。
+    struct stopGuard {
+        ~stopGuard() {
+            if(!isReading)
+                return;
+            try {
+                impl.readStopReq();
+            }catch(...) {
+            }
+        }
+
+        adir01pcppImpl& impl;
+        bool            isReading;
+    } guard{*impl, false};
+
+    auto start = [&] {
+        guard.isReading = true;
+        impl->readStartReq(frequency);
+    };
+
+    //区間ごとのデータはsinkに渡したら捨てるので, 使うメモリは読み取る時間によらず一定になる。
+    IRData  segment;
+    bool    isFirst = true;
+    auto flush = [&] {
+        guard.isReading = false;
+        impl->readStopReq();
+        segment.clear();
+        if(!isFirst)
+            segment.insert(segment.end(), gap, gap + sizeof(gap));
+        const auto begin = segment.size();
+        while(impl->readDataGetReq(segment)){}
+        if(segment.size() == begin)
+            return;
+
+        sink(segment);
+        isFirst = false;
+    };
+
+    start();
+    while(isContinue()) {
+        this_thread::sleep_for(capturePollInterval);
+        if(impl->readingDataSize() < rollSize)
+            continue;
+
+        if(isDebugPrint())
+            debugLog("Rolling capture buffer\n");
+        flush();
+        start();
+    }
+    flush();
+}
+
+adir01pcpp::segmentSink adir01pcpp::makeFileSink(const std::string& filename, uint16_t frequency) {
+    //sinkはコピーされることがあるので, ファイルと書き込んだバイト数を共有する。
+    struct fileState {
+        decltype(openFile(std::string(), "")) file;
+        size_t count;
+    };
+    auto state = std::make_shared<fileState>(fileState{openFile(filename, "w"), 0});
+    if(fprintf(state->file.get(), "%x\n", unsigned(frequency)) < 0 || fflush(state->file.get()) != 0)
+        fail(errc::fileError, "Failed to write IR data");
+
+    return [state](const IRData& segment) {
+        auto file = state->file.get();
+        for(const auto v : segment) {
+            state->count++;
+            if(fprintf(file, "%2x%c", unsigned(v), (state->count & 0xf) == 0 ? '\n' : ' ') < 0)
+                fail(errc::fileError, "Failed to write IR data");
+        }
+        if(fflush(file) != 0)
+            fail(errc::fileError, "Failed to write IR data");
+    };
 }
 
 void adir01pcpp::readStart(uint16_t frequency) {
@@ -466,18 +1039,67 @@ void adir01pcpp::enableUSBIOPrint() noexcept {
     ::enableUSBIOPrint = true;
 }
 
-void adir01pcpp::printIRData(std::ostream& ost, const IRData& data) {
-    ost << std::hex;
-    ost << "Size: " << data.size() << endl;
-    const size_t size = data.size() / 2;
-    size_t i = 0;
-    for(; i<size; ++i) {
-        uint16_t v = data[i*2] << 8 | data[i*2+1];
-        ost << v << ',';
-        if((i+1) % 16 == 0)
-            ost << endl;
-    }
-    if(i % 16 != 0)
-        ost << endl;
+const std::error_category& adir01pcpp::errorCategory() noexcept {
+    static const errorCategoryImpl category;
+    return category;
+}
+
+std::error_code make_error_code(adir01pcpp::errc e) noexcept {
+    return std::error_code(static_cast<int>(e), adir01pcpp::errorCategory());
+}
+
+void adir01pcpp::open(std::error_code& ec) {
+    withErrorCode(ec, [this] {open();});
+}
+
+void adir01pcpp::startUSBRecord(const std::string& traceFile, std::error_code& ec) {
+    withErrorCode(ec, [this, &traceFile] {startUSBRecord(traceFile);});
+}
+
+std::string adir01pcpp::getFirmwareVersion(std::error_code& ec) {
+    return withErrorCode(ec, [this] {return getFirmwareVersion();});
+}
+
+adir01pcpp::IRData adir01pcpp::readIRData(std::error_code& ec, uint16_t frequency) {
+    return withErrorCode(ec, [this, frequency] {return readIRData(frequency);});
+}
+
+void adir01pcpp::sendIR(const IRData& data, std::error_code& ec, uint16_t frequency) {
+    withErrorCode(ec, [this, &data, frequency] {sendIR(data, frequency);});
+}
+
+void adir01pcpp::readLongIRData(const segmentSink& sink, const std::function<bool()>& isContinue, std::error_code& ec, uint16_t frequency, uint16_t rollSize) {
+    withErrorCode(ec, [&] {readLongIRData(sink, isContinue, frequency, rollSize);});
+}
+
+void adir01pcpp::readStart(std::error_code& ec, uint16_t frequency) {
+    withErrorCode(ec, [this, frequency] {readStart(frequency);});
+}
+
+void adir01pcpp::sendIR(const PreparedSignal& signal, std::error_code& ec) {
+    withErrorCode(ec, [this, &signal] {sendIR(signal);});
+}
+
+adir01pcpp::PreparedSignal adir01pcpp::prepare(const IRData& data, std::error_code& ec, uint16_t frequency) {
+    return withErrorCode(ec, [&data, frequency] {return prepare(data, frequency);});
+}
+
+bool adir01pcpp::waitSendComplete(std::error_code& ec, std::chrono::milliseconds timeout) {
+    return withErrorCode(ec, [this, timeout] {return waitSendComplete(timeout);});
+}
+
+adir01pcpp::IRData adir01pcpp::getReadingData(std::error_code& ec) {
+    return withErrorCode(ec, [this] {return getReadingData();});
+}
+
+void adir01pcpp::readStop(std::error_code& ec) {
+    withErrorCode(ec, [this] {readStop();});
+}
+
+adir01pcpp::IRData adir01pcpp::getReadData(std::error_code& ec) {
+    return withErrorCode(ec, [this] {return getReadData();});
 }
 
+adir01pcpp::segmentSink adir01pcpp::makeFileSink(const std::string& filename, std::error_code& ec, uint16_t frequency) {
+    return withErrorCode(ec, [&filename, frequency] {return makeFileSink(filename, frequency);});
+}
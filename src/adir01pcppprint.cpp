@@ -0,0 +1,20 @@
+#include "adir01pcpp.hpp"
+
+#include <ostream>
+
+using namespace std;
+
+void adir01pcpp::printIRData(std::ostream& ost, const IRData& data) {
+    ost << std::hex;
+    ost << "Size: " << data.size() << endl;
+    const size_t size = data.size() / 2;
+    size_t i = 0;
+    for(; i<size; ++i) {
+        uint16_t v = data[i*2] << 8 | data[i*2+1];
+        ost << v << ',';
+        if((i+1) % 16 == 0)
+            ost << endl;
+    }
+    if(i % 16 != 0)
+        ost << endl;
+}